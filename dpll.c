@@ -1,14 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #define SATISFIABLE 1
 #define UNSATISFIABLE -1
 #define UNCERTAIN 0
 
+#define CORE_MINIMIZATION_BUDGET 200 // dpll calls spent on trying to drop one member of a core
+
+#define CACHE_VERSION 1
+#define CACHE_SIZE_LIMIT (64 * 1024 * 1024) // max total bytes of cache entries before eviction
+#define CACHE_PATH_LENGTH 4096
+#define CACHE_STALE_SECONDS 3600 // age after which a leftover temporary file is considered abandoned
+
 int DEBUG = 0; // set to 1 for debugging prints
 int clauseNumber, variableNumber;
 int * valuation; // global valuation array for ease of access during recursion
+int * refutation; // sorted ids of the assumptions behind the last UNSATISFIABLE answer
+int refutationCount;
+int decisionLevel; // depth of the current branch, decisions are tagged with its negation
+long dpllBudget = -1; // dpll calls left before giving up with UNCERTAIN, -1 for no limit
 
 struct Literal {
   struct Literal * next; // points to the next literal in the clause
@@ -18,6 +38,22 @@ struct Literal {
 struct Clause {
   struct Literal * head; // points to the first literal in the clause
   struct Clause * next; // points to the next clause in the set
+  int * assumptions; // sorted ids of the assumption (>= 0) and decision (< 0) clauses this clause was derived with
+  int assumptionCount;
+};
+
+// a clause with its literals sorted and duplicates removed
+struct SortedClause {
+  int length;
+  int * literals;
+};
+
+// canonical form of a clause set: clauses sorted and duplicates removed,
+// so that formulas differing only in ordering and comments compare equal
+struct Formula {
+  int clauseCount;
+  int literalCount;
+  struct SortedClause * clauses;
 };
 
 // creates, initializes and returns an empty Clause
@@ -25,6 +61,8 @@ struct Clause * createClause(){
   struct Clause * instance = malloc(sizeof(struct Clause));
   instance->head = NULL;
   instance->next = NULL;
+  instance->assumptions = NULL;
+  instance->assumptionCount = 0;
   return instance;
 }
 
@@ -36,6 +74,67 @@ struct Literal * createLiteral(){
   return instance;
 }
 
+void removeLiteral(struct Literal * literal){
+  while (literal != NULL) {
+    struct Literal * next = literal->next;
+    free(literal);
+    literal = next;
+  }
+}
+
+void removeClause(struct Clause * root){
+  while (root != NULL) {
+    struct Clause * next = root->next;
+    if (root->head != NULL) removeLiteral(root->head);
+    free(root->assumptions);
+    free(root);
+    root = next;
+  }
+}
+
+// frees a single clause and its literals, leaving the rest of the set alone
+void freeClause(struct Clause * clause){
+  removeLiteral(clause->head);
+  free(clause->assumptions);
+  free(clause);
+}
+
+// copies a sorted list of assumption ids
+int * copyAssumptions(int * assumptions, int count){
+  if (count == 0) return NULL;
+  int * copy = malloc(count * sizeof(int));
+  memcpy(copy, assumptions, count * sizeof(int));
+  return copy;
+}
+
+// merges the sorted assumption ids of source into target, keeping them sorted and unique
+void mergeAssumptions(int ** target, int * targetCount, int * source, int sourceCount){
+  if (sourceCount == 0) return;
+  int * merged = malloc((*targetCount + sourceCount) * sizeof(int));
+  int i = 0, j = 0, count = 0;
+  while (i < *targetCount || j < sourceCount) {
+    if (j == sourceCount || (i < *targetCount && (*target)[i] < source[j])) merged[count++] = (*target)[i++];
+    else if (i == *targetCount || source[j] < (*target)[i]) merged[count++] = source[j++];
+    else {
+      merged[count++] = source[j++];
+      i++;
+    }
+  }
+  free(*target);
+  *target = merged;
+  *targetCount = count;
+}
+
+// removes an id from a sorted list of assumption ids, returns 1 if it was there
+int dropAssumption(int * assumptions, int * count, int id){
+  int i;
+  for (i = 0; i < *count && assumptions[i] != id; i++);
+  if (i == *count) return 0;
+  memmove(&assumptions[i], &assumptions[i + 1], (*count - i - 1) * sizeof(int));
+  (*count)--;
+  return 1;
+}
+
 // prints the current state of the valuation array
 void printValuation(){
   int i;
@@ -58,8 +157,8 @@ void printClauseSet(struct Clause * root){
   }
 }
 
-// finds a unit clause and return its literal index for unit-propagation step
-int findUnitClause(struct Clause * root){
+// finds a unit clause and returns it for unit-propagation step
+struct Clause * findUnitClause(struct Clause * root){
   struct Clause * itr = root;
   while (itr != NULL){
     if (itr->head == NULL) {
@@ -67,12 +166,12 @@ int findUnitClause(struct Clause * root){
       continue;
     }
     if(itr->head->next == NULL){
-      return itr->head->index;
+      return itr;
     }
     itr = itr->next;
   }
-  // no unit clause found, return 0
-  return 0;
+  // no unit clause found, return NULL
+  return NULL;
 }
 
 // signal function
@@ -100,8 +199,13 @@ int findPureLiteral(struct Clause * root){
   // iterate over the lookup table to send the first pure literal found
   int i;
   for (i = 1; i < variableNumber + 1; i++) {
-    if (literalLookup[i] == -1 || literalLookup[i] == 1) return i * literalLookup[i];
+    if (literalLookup[i] == -1 || literalLookup[i] == 1) {
+      int pureLiteralIndex = i * literalLookup[i];
+      free(literalLookup);
+      return pureLiteralIndex;
+    }
   }
+  free(literalLookup);
   // no pure literal found, return 0
   return 0;
 }
@@ -109,10 +213,16 @@ int findPureLiteral(struct Clause * root){
 // implements unit propagation algorithm
 // returns 0 if it's unable to perform the algorithm in case there are no unit literals
 int unitPropagation(struct Clause * root){
-  int unitLiteralIndex = findUnitClause(root);
+  struct Clause * unitClause = findUnitClause(root);
+  int unitLiteralIndex = unitClause == NULL ? 0 : unitClause->head->index;
   if (DEBUG) printf("unit clause found with literal: %d\n", unitLiteralIndex);
   if (unitLiteralIndex == 0) return 0;
 
+  // every clause the unit shortens is derived with the unit's assumptions as well
+  // copy them, the unit clause itself is removed during the propagation
+  int unitAssumptionCount = unitClause->assumptionCount;
+  int * unitAssumptions = copyAssumptions(unitClause->assumptions, unitAssumptionCount);
+
   // set the valuation for that literal
   if (DEBUG) printf("Setting value of literal %d as %d\n", abs(unitLiteralIndex), unitLiteralIndex > 0 ? 1 : 0);
   valuation[abs(unitLiteralIndex)] = unitLiteralIndex > 0 ? 1 : 0;
@@ -124,17 +234,30 @@ int unitPropagation(struct Clause * root){
   struct Clause * prev;
   while (itr != NULL){
     struct Literal * currentL = itr->head;
-    struct Literal * previousL = createLiteral();
+    struct Literal * previousL = NULL;
     while (currentL != NULL){
       if (currentL->index == unitLiteralIndex) {
         // unit literal found, remove whole clause and re-adjust pointers
         if (DEBUG) printf("Removing the clause that starts with %d\n", itr->head->index);
-        if (itr == root){
+        if (itr == root && root->next == NULL){
+          // the last clause can't be unlinked in place, shrink it to the
+          // satisfied literal instead so that the set reads as solved
+          removeLiteral(root->head);
+          root->head = createLiteral();
+          root->head->index = unitLiteralIndex;
+          break;
+        } else if (itr == root){
           // the root has to change if we are removing the first clause
-          *root = *(root->next);
+          // the next clause is copied into the root node, so that's the node to free
+          struct Clause * next = root->next;
+          removeLiteral(root->head);
+          free(root->assumptions);
+          *root = *next;
+          free(next);
           itr = NULL;
         } else {
           prev->next = itr->next;
+          freeClause(itr);
           itr = prev;
         }
         break;
@@ -142,11 +265,15 @@ int unitPropagation(struct Clause * root){
         // negated unit literal found, remove it from the clause. Other literals should stay
         if (DEBUG) printf("Removing the literal %d from the clause that starts with %d\n", currentL->index, itr->head->index);
         // if it's the first literal in the clause, the head pointer has to change
+        // keep scanning from the following literal, it may repeat in the clause
+        struct Literal * removedL = currentL;
+        mergeAssumptions(&itr->assumptions, &itr->assumptionCount, unitAssumptions, unitAssumptionCount);
         if (currentL == itr->head) itr->head = currentL->next;
         else {
           previousL->next = currentL->next;
         }
-        currentL = previousL;
+        currentL = currentL->next;
+        free(removedL);
         continue;
       }
       // update loop variables for easier access in following iterations
@@ -158,6 +285,7 @@ int unitPropagation(struct Clause * root){
     prev = itr;
     itr = itr == NULL ? root : itr->next;
   }
+  free(unitAssumptions);
   return 1;
 }
 
@@ -182,12 +310,25 @@ int pureLiteralElimination(struct Clause * root){
       if (l->index == pureLiteralIndex) {
         // unit literal found, remove whole clause and re-adjust pointers
         if (DEBUG) printf("Removing the clause that starts with %d\n", itr->head->index);
-        if (itr == root){
+        if (itr == root && root->next == NULL){
+          // the last clause can't be unlinked in place, shrink it to the
+          // satisfied literal instead so that the set reads as solved
+          removeLiteral(root->head);
+          root->head = createLiteral();
+          root->head->index = pureLiteralIndex;
+          break;
+        } else if (itr == root){
           // the root has to change if we are removing the first clause
-          *root = *(root->next);
+          // the next clause is copied into the root node, so that's the node to free
+          struct Clause * next = root->next;
+          removeLiteral(root->head);
+          free(root->assumptions);
+          *root = *next;
+          free(next);
           itr = NULL;
         } else {
           prev->next = itr->next;
+          freeClause(itr);
           itr = prev;
         }
         break;
@@ -284,13 +425,17 @@ int areAllClausesUnit(struct Clause * root){
       int seen = literalLookup[abs(l->index)];
       if (seen == 0) literalLookup[abs(l->index)] = sign(l->index);
       // if we previously have seen this literal with the opposite sign, return false
-      else if (seen == -1 && sign(l->index) == 1) return 0;
-      else if (seen == 1 && sign(l->index) == -1) return 0;
+      else if (seen != sign(l->index)) {
+        free(literalLookup);
+        return 0;
+      }
       l = l->next;
     }
     itr = itr->next;
   }
 
+  free(literalLookup);
+
   // if we reached here, that means the clause set contains no conflicting literals
   // iterate over the clause set one last time to decide their valuation
   itr = root;
@@ -307,20 +452,27 @@ int areAllClausesUnit(struct Clause * root){
   return 1;
 }
 
-// returns if the clause set contains and empty clause with no literal within
-int containsEmptyClause(struct Clause * root){
+// returns an empty clause with no literal within, or NULL if the clause set has none
+struct Clause * findEmptyClause(struct Clause * root){
   struct Clause* itr = root;
   while (itr != NULL){
     // if the head pointer is null, no literals
-    if(itr->head == NULL) return 1;
+    if(itr->head == NULL) return itr;
     itr = itr->next;
   }
-  return 0;
+  return NULL;
 }
 
 // checks if the current state of the clause set represents a solution
 int checkSolution(struct Clause * root){
-  if (containsEmptyClause(root)) return UNSATISFIABLE;
+  struct Clause * emptyClause = findEmptyClause(root);
+  if (emptyClause != NULL) {
+    // the assumptions the empty clause was derived with are what refutes this branch
+    free(refutation);
+    refutationCount = emptyClause->assumptionCount;
+    refutation = copyAssumptions(emptyClause->assumptions, refutationCount);
+    return UNSATISFIABLE;
+  }
   if (areAllClausesUnit(root)) return SATISFIABLE;
   return UNCERTAIN;
 }
@@ -336,6 +488,8 @@ int chooseLiteral(struct Clause * root){
 // deep clones a clause constructing a new clause and literal structs
 struct Clause * cloneClause(struct Clause * origin){
   struct Clause * cloneClause = createClause();
+  cloneClause->assumptionCount = origin->assumptionCount;
+  cloneClause->assumptions = copyAssumptions(origin->assumptions, origin->assumptionCount);
   struct Literal * iteratorLiteral = origin->head;
   struct Literal * previousLiteral = NULL;
 
@@ -355,19 +509,9 @@ struct Clause * cloneClause(struct Clause * origin){
   return cloneClause;
 }
 
-// deep clones a clause set and injects a new unit clause with the given literal index
-// this is how branching is performed
-struct Clause * branch(struct Clause * root, int literalIndex){
-  if (DEBUG) printf("Branching with literal %d\n", literalIndex);
-  if (DEBUG) printf("Setting value of literal %d as %d\n", abs(literalIndex), literalIndex > 0 ? 1 : 0);
-
-  // set the valuation of the literal
-  // we may backtrack and this valuation may become obsolete, but it doesn't matter
-  // since the backtracked branch will overwrite this with the new valuation
-  valuation[abs(literalIndex)] = literalIndex > 0 ? 1 : 0;
-
+// deep clones a whole clause set, clause by clause
+struct Clause * cloneClauseSet(struct Clause * root){
   struct Clause * newClone = NULL,
-                * currentClause = NULL,
                 * previousClause = NULL,
                 * iterator = root;
   // deep clone each clause one by one
@@ -382,37 +526,53 @@ struct Clause * branch(struct Clause * root, int literalIndex){
     previousClause = clone;
     iterator = iterator->next;
   }
-  // create a new unit clause with the given literalIndex
-  // add it to the first place as the new root, because we want to make sure
-  // that the same literalIndex will be chosen in the following immediate unit-propagation
-  struct Clause * addedClause = createClause();
-  struct Literal * addedLiteral = createLiteral();
-  addedLiteral->index = literalIndex;
-  addedClause->head = addedLiteral;
-
-  addedClause->next = newClone;
-  return addedClause;
+  return newClone;
 }
 
-void removeLiteral(struct Literal * literal){
-  while (literal != NULL) {
-    struct Literal * next = literal->next;
-    free(literal);
-    literal = next;
+// creates a clause with the given literals and puts it in front of the clause set
+// returns the new root
+struct Clause * addClause(struct Clause * root, int * literals, int length){
+  struct Clause * addedClause = createClause();
+  int i;
+  for (i = length - 1; i >= 0; i--) {
+    struct Literal * addedLiteral = createLiteral();
+    addedLiteral->index = literals[i];
+    addedLiteral->next = addedClause->head;
+    addedClause->head = addedLiteral;
   }
+  addedClause->next = root;
+  return addedClause;
 }
 
-void removeClause(struct Clause * root){
-  while (root != NULL) {
-    struct Clause * next = root->next;
-    if (root->head != NULL) removeLiteral(root->head);
-    free(root);
-    root = next;
-  }
+// deep clones a clause set and injects a new unit clause with the given literal index
+// this is how branching is performed
+struct Clause * branch(struct Clause * root, int literalIndex){
+  if (DEBUG) printf("Branching with literal %d\n", literalIndex);
+  if (DEBUG) printf("Setting value of literal %d as %d\n", abs(literalIndex), literalIndex > 0 ? 1 : 0);
+
+  // set the valuation of the literal
+  // we may backtrack and this valuation may become obsolete, but it doesn't matter
+  // since the backtracked branch will overwrite this with the new valuation
+  valuation[abs(literalIndex)] = literalIndex > 0 ? 1 : 0;
+
+  // create a new unit clause with the given literalIndex
+  // add it to the first place as the new root, because we want to make sure
+  // that the same literalIndex will be chosen in the following immediate unit-propagation
+  return addClause(cloneClauseSet(root), &literalIndex, 1);
 }
 
 // DPLL algorithm with recursive backtracking
+// takes ownership of the clause set and frees it before returning
+// returns UNCERTAIN only if dpllBudget runs out
+// when unsatisfiable, `refutation` lists the assumption clauses the answer depends on
 int dpll(struct Clause * root){
+  // out of budget, give up without an answer
+  if (dpllBudget == 0) {
+    removeClause(root);
+    return UNCERTAIN;
+  }
+  if (dpllBudget > 0) dpllBudget--;
+
   // first check if we are already in a solved state
   int solution = checkSolution(root);
   if (solution != UNCERTAIN){
@@ -445,10 +605,37 @@ int dpll(struct Clause * root){
   if (DEBUG) printf("Branching on literal %d\n", literalIndex);
 
   //   - insert a new unit clause with this chosen literal, and recurse
-  if (dpll(branch(root, literalIndex)) == SATISFIABLE) return SATISFIABLE;
+  //     the unit is tagged so refutations tell whether they depend on this decision
+  int decision = -(++decisionLevel);
+  struct Clause * decided = branch(root, literalIndex);
+  decided->assumptions = copyAssumptions(&decision, 1);
+  decided->assumptionCount = 1;
+  solution = dpll(decided);
+  if (solution != UNSATISFIABLE || !dropAssumption(refutation, &refutationCount, decision)) {
+    // a refutation that doesn't involve the decision refutes this node too,
+    // so the negated branch needn't be searched (backjumping)
+    decisionLevel--;
+    removeClause(root);
+    return solution;
+  }
 
   //   - if it doesn't yield a solution, try the same with the negated literal
-  return dpll(branch(root, -literalIndex));
+  //     together both branches' refutations refute this node
+  int * firstRefutation = refutation, firstRefutationCount = refutationCount;
+  refutation = NULL;
+  refutationCount = 0;
+  decided = branch(root, -literalIndex);
+  decided->assumptions = copyAssumptions(&decision, 1);
+  decided->assumptionCount = 1;
+  solution = dpll(decided);
+  if (solution == UNSATISFIABLE) {
+    dropAssumption(refutation, &refutationCount, decision);
+    mergeAssumptions(&refutation, &refutationCount, firstRefutation, firstRefutationCount);
+  }
+  free(firstRefutation);
+  decisionLevel--;
+  removeClause(root);
+  return solution;
 }
 
 // writes the solution to the given file
@@ -468,15 +655,728 @@ void writeSolution(struct Clause * root, char * filename){
   fclose(f);
 }
 
+// orders integers ascending, used for sorting literals within a clause
+int compareLiterals(const void * a, const void * b){
+  int x = *(const int *) a, y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+// orders sorted clauses by length first, then literal by literal
+int compareClauses(const void * a, const void * b){
+  const struct SortedClause * x = a, * y = b;
+  if (x->length != y->length) return (x->length > y->length) - (x->length < y->length);
+  int i;
+  for (i = 0; i < x->length; i++) {
+    int order = compareLiterals(&x->literals[i], &y->literals[i]);
+    if (order != 0) return order;
+  }
+  return 0;
+}
+
+// builds the canonical form of the clause set: literals sorted within each clause,
+// clauses sorted, duplicate literals and duplicate clauses removed
+struct Formula * normalizeClauseSet(struct Clause * root){
+  struct Formula * formula = malloc(sizeof(struct Formula));
+  formula->clauseCount = 0;
+  formula->literalCount = 0;
+
+  struct Clause * itr = root;
+  while (itr != NULL){
+    formula->clauseCount++;
+    itr = itr->next;
+  }
+  formula->clauses = calloc(formula->clauseCount + 1, sizeof(struct SortedClause));
+
+  int c = 0;
+  for (itr = root; itr != NULL; itr = itr->next, c++){
+    struct Literal * l;
+    int length = 0;
+    for (l = itr->head; l != NULL; l = l->next) length++;
+
+    int * literals = malloc((length + 1) * sizeof(int));
+    length = 0;
+    for (l = itr->head; l != NULL; l = l->next) literals[length++] = l->index;
+    qsort(literals, length, sizeof(int), compareLiterals);
+
+    // drop repeated literals, they are adjacent after sorting
+    int i, unique = 0;
+    for (i = 0; i < length; i++) {
+      if (unique == 0 || literals[unique - 1] != literals[i]) literals[unique++] = literals[i];
+    }
+    formula->clauses[c].length = unique;
+    formula->clauses[c].literals = literals;
+  }
+  qsort(formula->clauses, formula->clauseCount, sizeof(struct SortedClause), compareClauses);
+
+  // drop repeated clauses, they are adjacent after sorting
+  int i, unique = 0;
+  for (i = 0; i < formula->clauseCount; i++) {
+    if (unique > 0 && compareClauses(&formula->clauses[unique - 1], &formula->clauses[i]) == 0) {
+      free(formula->clauses[i].literals);
+      continue;
+    }
+    formula->clauses[unique++] = formula->clauses[i];
+    formula->literalCount += formula->clauses[i].length;
+  }
+  formula->clauseCount = unique;
+  return formula;
+}
+
+void removeFormula(struct Formula * formula){
+  int i;
+  for (i = 0; i < formula->clauseCount; i++) free(formula->clauses[i].literals);
+  free(formula->clauses);
+  free(formula);
+}
+
+// scrambles the bits of a 64-bit word (splitmix64 finalizer)
+uint64_t mixHash(uint64_t x){
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// hashes the canonical formula, different seeds give independent hashes
+uint64_t hashFormula(struct Formula * formula, uint64_t seed){
+  uint64_t hash = mixHash(seed ^ (uint32_t) variableNumber);
+  int c, i;
+  for (c = 0; c < formula->clauseCount; c++) {
+    hash = mixHash(hash ^ (uint32_t) formula->clauses[c].length);
+    for (i = 0; i < formula->clauses[c].length; i++) {
+      hash = mixHash(hash ^ (uint32_t) formula->clauses[c].literals[i]);
+    }
+  }
+  return hash;
+}
+
+// checks that the current valuation satisfies every clause of the formula
+int verifyValuation(struct Formula * formula){
+  int c, i;
+  for (c = 0; c < formula->clauseCount; c++) {
+    int satisfied = 0;
+    for (i = 0; i < formula->clauses[c].length && !satisfied; i++) {
+      int literal = formula->clauses[c].literals[i];
+      if (abs(literal) > variableNumber) continue;
+      satisfied = valuation[abs(literal)] == (literal > 0 ? 1 : 0);
+    }
+    if (!satisfied) return 0;
+  }
+  return 1;
+}
+
+// builds the path of the cache entry for the formula
+void cacheEntryPath(char * path, char * cacheDir, struct Formula * formula){
+  snprintf(path, CACHE_PATH_LENGTH, "%s/%016" PRIx64 ".cache", cacheDir, hashFormula(formula, 0));
+}
+
+// looks the formula up in the cache directory
+// returns the cached status, with the valuation filled in when satisfiable,
+// or UNCERTAIN on a miss. A cached model is only trusted if it satisfies the input
+int cacheLookup(char * cacheDir, struct Formula * formula){
+  char path[CACHE_PATH_LENGTH];
+  cacheEntryPath(path, cacheDir, formula);
+  FILE * fp = fopen(path, "r");
+  if (fp == NULL) return UNCERTAIN;
+
+  // the header repeats the formula's shape and a second hash to rule out collisions
+  int version, vars, clauses, literals;
+  uint64_t check;
+  char status[32], marker[2];
+  int result = UNCERTAIN;
+  if (fscanf(fp, "dpll-cache %d %d %d %d %" SCNx64 " s %31s", &version, &vars, &clauses, &literals, &check, status) == 6
+      && version == CACHE_VERSION && vars == variableNumber && clauses == formula->clauseCount
+      && literals == formula->literalCount && check == hashFormula(formula, 1)) {
+    if (strcmp(status, "UNSATISFIABLE") == 0) result = UNSATISFIABLE;
+    else if (strcmp(status, "SATISFIABLE") == 0 && fscanf(fp, " %1s", marker) == 1 && marker[0] == 'v') {
+      // read the model as a zero-terminated list of literals
+      int literal = -1;
+      result = SATISFIABLE;
+      while (fscanf(fp, "%d", &literal) == 1 && literal != 0) {
+        if (abs(literal) > variableNumber) {
+          result = UNCERTAIN;
+          break;
+        }
+        valuation[abs(literal)] = literal > 0 ? 1 : 0;
+      }
+      if (literal != 0 || (result == SATISFIABLE && !verifyValuation(formula))) result = UNCERTAIN;
+    }
+  }
+  fclose(fp);
+
+  if (result == UNCERTAIN) {
+    // stale or corrupt entry, forget it and whatever valuation it left behind
+    if (DEBUG) printf("Discarding cache entry %s\n", path);
+    unlink(path);
+    int i;
+    for (i = 0; i < variableNumber + 1; i++) valuation[i] = -1;
+  } else {
+    // refresh the modification time so eviction treats it as recently used
+    utime(path, NULL);
+  }
+  return result;
+}
+
+// a cache entry seen while scanning the cache directory for eviction
+struct CacheEntry {
+  char name[256];
+  off_t size;
+  time_t modified;
+};
+
+// orders cache entries from least to most recently used
+int compareCacheEntries(const void * a, const void * b){
+  const struct CacheEntry * x = a, * y = b;
+  return (x->modified > y->modified) - (x->modified < y->modified);
+}
+
+// checks whether the file name ends with the given suffix
+int hasSuffix(char * name, char * suffix){
+  size_t length = strlen(name), suffixLength = strlen(suffix);
+  return length >= suffixLength && strcmp(name + length - suffixLength, suffix) == 0;
+}
+
+// removes least recently used entries until the cache fits in CACHE_SIZE_LIMIT
+// temporary files abandoned by killed solvers are removed as well
+void cacheEvict(char * cacheDir){
+  DIR * dir = opendir(cacheDir);
+  if (dir == NULL) return;
+
+  int count = 0, capacity = 64;
+  struct CacheEntry * entries = malloc(capacity * sizeof(struct CacheEntry));
+  off_t total = 0;
+  char path[CACHE_PATH_LENGTH];
+  struct dirent * item;
+  struct stat info;
+  time_t now = time(NULL);
+  while ((item = readdir(dir)) != NULL) {
+    if (hasSuffix(item->d_name, ".tmp")) {
+      snprintf(path, sizeof(path), "%s/%s", cacheDir, item->d_name);
+      // a writer renames its file right away, an old one belongs to a dead process
+      if (stat(path, &info) == 0 && now - info.st_mtime > CACHE_STALE_SECONDS) {
+        if (DEBUG) printf("Removing abandoned cache file %s\n", path);
+        unlink(path);
+      }
+      continue;
+    }
+    if (!hasSuffix(item->d_name, ".cache") || strlen(item->d_name) >= sizeof(entries->name)) continue;
+    snprintf(path, sizeof(path), "%s/%s", cacheDir, item->d_name);
+    if (stat(path, &info) != 0) continue;
+    if (count == capacity) {
+      capacity *= 2;
+      entries = realloc(entries, capacity * sizeof(struct CacheEntry));
+    }
+    strcpy(entries[count].name, item->d_name);
+    entries[count].size = info.st_size;
+    entries[count].modified = info.st_mtime;
+    total += info.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  qsort(entries, count, sizeof(struct CacheEntry), compareCacheEntries);
+  int i;
+  for (i = 0; i < count && total > CACHE_SIZE_LIMIT; i++) {
+    snprintf(path, sizeof(path), "%s/%s", cacheDir, entries[i].name);
+    if (DEBUG) printf("Evicting cache entry %s\n", path);
+    // another process may have evicted it already, the space is gone either way
+    unlink(path);
+    total -= entries[i].size;
+  }
+  free(entries);
+}
+
+// stores the solver's answer for the formula in the cache directory
+// the entry is written to a private temporary file and renamed into place,
+// so concurrent solvers never observe a partially written entry
+void cacheStore(char * cacheDir, struct Formula * formula, int result){
+  // never cache a model that does not hold up against the input
+  if (result == SATISFIABLE && !verifyValuation(formula)) return;
+
+  char path[CACHE_PATH_LENGTH], temporaryPath[CACHE_PATH_LENGTH + 32];
+  cacheEntryPath(path, cacheDir, formula);
+  snprintf(temporaryPath, sizeof(temporaryPath), "%s.%ld.tmp", path, (long) getpid());
+
+  FILE * fp = fopen(temporaryPath, "w");
+  if (fp == NULL) return;
+  fprintf(fp, "dpll-cache %d %d %d %d %016" PRIx64 "\n", CACHE_VERSION, variableNumber,
+          formula->clauseCount, formula->literalCount, hashFormula(formula, 1));
+  fprintf(fp, "s %s\n", result == SATISFIABLE ? "SATISFIABLE" : "UNSATISFIABLE");
+  if (result == SATISFIABLE) {
+    fprintf(fp, "v");
+    int i;
+    for (i = 1; i < variableNumber + 1; i++) {
+      if (valuation[i] != -1) fprintf(fp, " %d", valuation[i] ? i : -i);
+    }
+    fprintf(fp, " 0\n");
+  }
+  int failed = ferror(fp);
+  if (fclose(fp) != 0 || failed || rename(temporaryPath, path) != 0) {
+    unlink(temporaryPath);
+    return;
+  }
+  cacheEvict(cacheDir);
+}
+
+// bumps the shared hit or miss counter kept in the cache directory and reports both
+// the counter file is locked so concurrent solvers don't lose updates
+void cacheCount(char * cacheDir, int hit){
+  char path[CACHE_PATH_LENGTH];
+  snprintf(path, sizeof(path), "%s/stats", cacheDir);
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return;
+  flock(fd, LOCK_EX);
+
+  char buffer[128] = {0};
+  long hits = 0, misses = 0;
+  if (read(fd, buffer, sizeof(buffer) - 1) > 0) sscanf(buffer, "hits %ld misses %ld", &hits, &misses);
+  if (hit) hits++;
+  else misses++;
+
+  int length = snprintf(buffer, sizeof(buffer), "hits %ld\nmisses %ld\n", hits, misses);
+  if (ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 && write(fd, buffer, length) == length) {
+    fprintf(stderr, "cache %s (hits: %ld, misses: %ld)\n", hit ? "hit" : "miss", hits, misses);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+// a totalizer node counting how many of its inputs are true
+// internal nodes only encode their first `bound` outputs, the bound is raised on demand
+struct Totalizer {
+  int size; // number of inputs below this node
+  int bound; // number of outputs encoded so far
+  int * outputs; // outputs[j] is implied when at least j + 1 inputs are true
+  struct Totalizer * left, * right;
+};
+
+// a soft constraint as seen by the optimizer: satisfied when `literal` is true
+// totalizer outputs become soft literals too, they remember where they came from
+struct SoftLiteral {
+  int literal;
+  long long weight; // weight not yet accounted for in the lower bound
+  struct Totalizer * totalizer; // the sum this literal bounds, NULL for input soft clauses
+  int bound; // literal is the negation of totalizer->outputs[bound - 1]
+};
+
+// state of a MaxSAT optimization run
+struct MaxSat {
+  struct Clause * hard; // hard clauses plus relaxation and totalizer clauses
+  struct Clause ** soft; // original soft clauses, kept to evaluate the cost of models
+  long long * softWeights;
+  int softCount;
+  struct SoftLiteral * literals; // the objective being relaxed by the cores
+  int literalCount, literalCapacity;
+  int originalVariables; // variables of the input, the rest are auxiliary
+  long long lowerBound, upperBound;
+  int * bestModel; // best valuation found so far, NULL until a model is found
+};
+
+// returns a fresh auxiliary variable
+int newVariable(){
+  return ++variableNumber;
+}
+
+// appends a literal to the objective and returns its position
+int addSoftLiteral(struct MaxSat * instance, int literal, long long weight, struct Totalizer * totalizer, int bound){
+  if (instance->literalCount == instance->literalCapacity) {
+    instance->literalCapacity = instance->literalCapacity * 2 + 16;
+    instance->literals = realloc(instance->literals, instance->literalCapacity * sizeof(struct SoftLiteral));
+  }
+  struct SoftLiteral * soft = &instance->literals[instance->literalCount];
+  soft->literal = literal;
+  soft->weight = weight;
+  soft->totalizer = totalizer;
+  soft->bound = bound;
+  return instance->literalCount++;
+}
+
+// checks whether the file holds a weighted formula, by its header or its extension
+int isWeightedFormula(char * filename){
+  size_t length = strlen(filename);
+  if (length > 5 && strcmp(filename + length - 5, ".wcnf") == 0) return 1;
+
+  FILE * fp = fopen(filename, "r");
+  if (fp == NULL) return 0;
+  char line[256];
+  int weighted = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == 'c') continue;
+    weighted = strncmp(line, "p wcnf", 6) == 0;
+    break;
+  }
+  fclose(fp);
+  return weighted;
+}
+
+// reads a weighted formula: every clause starts with its weight, clauses marked
+// with 'h' or weighing at least the top weight of the header are hard
+struct MaxSat * readWeightedClauseSet(char * filename){
+  FILE * fp = fopen(filename, "r");
+  if (fp == NULL) exit(1);
+
+  struct MaxSat * instance = calloc(1, sizeof(struct MaxSat));
+  long long top = -1;
+  int softCapacity = 0;
+  // clauses can be arbitrarily long, so lines and literals are read into growing buffers
+  char * line = NULL;
+  size_t lineCapacity = 0;
+  int literalCapacity = 16;
+  int * literals = malloc(literalCapacity * sizeof(int));
+
+  variableNumber = 0;
+  while (getline(&line, &lineCapacity, fp) != -1) {
+    if (line[0] == 'c' || line[0] == '%') continue;
+    if (line[0] == 'p') {
+      sscanf(line, "p wcnf %d %d %lld", &variableNumber, &clauseNumber, &top);
+      continue;
+    }
+
+    // split the line by whitespace, the first token is the weight
+    char * token = strtok(line, " \t\r\n");
+    if (token == NULL) continue;
+    int hard = strcmp(token, "h") == 0;
+    long long weight = hard ? 0 : atoll(token);
+    if (top > 0 && weight >= top) hard = 1;
+
+    int length = 0;
+    token = strtok(NULL, " \t\r\n");
+    while (token != NULL) {
+      int literalIndex = atoi(token);
+      if (literalIndex == 0) break;
+      if (abs(literalIndex) > variableNumber) variableNumber = abs(literalIndex);
+      if (length == literalCapacity) {
+        literalCapacity *= 2;
+        literals = realloc(literals, literalCapacity * sizeof(int));
+      }
+      literals[length++] = literalIndex;
+      token = strtok(NULL, " \t\r\n");
+    }
+
+    if (hard) {
+      instance->hard = addClause(instance->hard, literals, length);
+    } else if (weight > 0) {
+      if (instance->softCount == softCapacity) {
+        softCapacity = softCapacity * 2 + 16;
+        instance->soft = realloc(instance->soft, softCapacity * sizeof(struct Clause *));
+        instance->softWeights = realloc(instance->softWeights, softCapacity * sizeof(long long));
+      }
+      instance->soft[instance->softCount] = addClause(NULL, literals, length);
+      instance->softWeights[instance->softCount] = weight;
+      instance->softCount++;
+    }
+  }
+  free(line);
+  free(literals);
+  fclose(fp);
+  instance->originalVariables = variableNumber;
+  instance->upperBound = -1;
+
+  // relax every soft clause C with a fresh literal a and the hard clause (C or -a),
+  // so that assuming a enforces C. Unit soft clauses are their own literal
+  int i;
+  for (i = 0; i < instance->softCount; i++) {
+    struct Literal * l = instance->soft[i]->head;
+    if (l == NULL) {
+      // an empty soft clause is violated by every model
+      instance->lowerBound += instance->softWeights[i];
+    } else if (l->next == NULL) {
+      addSoftLiteral(instance, l->index, instance->softWeights[i], NULL, 0);
+    } else {
+      struct Clause * relaxed = cloneClause(instance->soft[i]);
+      int relaxation = newVariable();
+      struct Literal * added = createLiteral();
+      added->index = -relaxation;
+      added->next = relaxed->head;
+      relaxed->head = added;
+      relaxed->next = instance->hard;
+      instance->hard = relaxed;
+      addSoftLiteral(instance, relaxation, instance->softWeights[i], NULL, 0);
+    }
+  }
+  return instance;
+}
+
+// raises the number of encoded outputs of a totalizer node to the given bound
+// only the clauses that were not already part of the encoding are added
+void extendTotalizer(struct MaxSat * instance, struct Totalizer * node, int bound){
+  if (bound > node->size) bound = node->size;
+  if (bound <= node->bound) return;
+
+  int leftBound = node->left->bound, rightBound = node->right->bound, oldBound = node->bound;
+  extendTotalizer(instance, node->left, bound);
+  extendTotalizer(instance, node->right, bound);
+  int j;
+  for (j = oldBound; j < bound; j++) node->outputs[j] = newVariable();
+  node->bound = bound;
+
+  // i true inputs on the left and k on the right imply output i + k
+  int i, k;
+  for (i = 0; i <= node->left->bound; i++) {
+    for (k = 0; k <= node->right->bound; k++) {
+      if (i + k == 0 || i + k > bound) continue;
+      if (i <= leftBound && k <= rightBound && i + k <= oldBound) continue;
+      int literals[3], length = 0;
+      if (i > 0) literals[length++] = -node->left->outputs[i - 1];
+      if (k > 0) literals[length++] = -node->right->outputs[k - 1];
+      literals[length++] = node->outputs[i + k - 1];
+      instance->hard = addClause(instance->hard, literals, length);
+    }
+  }
+}
+
+// builds a totalizer tree over the given inputs, without encoding any outputs yet
+struct Totalizer * buildTotalizer(int * inputs, int count){
+  struct Totalizer * node = calloc(1, sizeof(struct Totalizer));
+  node->size = count;
+  node->outputs = malloc(count * sizeof(int));
+  if (count == 1) {
+    // leaves are the inputs themselves
+    node->outputs[0] = inputs[0];
+    node->bound = 1;
+    return node;
+  }
+  node->left = buildTotalizer(inputs, count / 2);
+  node->right = buildTotalizer(inputs + count / 2, count - count / 2);
+  return node;
+}
+
+// solves the hard clauses with the given literals assumed true
+// the clause set is cloned, so the instance survives the destructive dpll
+// each assumption is a unit clause tagged with its position, so that an
+// unsatisfiable answer leaves the positions it depends on in `refutation`
+int solveUnderAssumptions(struct MaxSat * instance, int * assumptions, int count){
+  valuation = realloc(valuation, (variableNumber + 1) * sizeof(int));
+  int i;
+  for (i = 0; i < variableNumber + 1; i++) valuation[i] = -1;
+
+  struct Clause * root = cloneClauseSet(instance->hard);
+  for (i = 0; i < count; i++) {
+    root = addClause(root, &assumptions[i], 1);
+    root->assumptions = copyAssumptions(&i, 1);
+    root->assumptionCount = 1;
+  }
+  return dpll(root);
+}
+
+// evaluates the model in the valuation array against the original soft clauses
+// and keeps it if it improves the upper bound
+void recordModel(struct MaxSat * instance){
+  long long cost = 0;
+  int i;
+  // unassigned variables don't matter to the hard clauses, fix them to false
+  for (i = 1; i < variableNumber + 1; i++) {
+    if (valuation[i] == -1) valuation[i] = 0;
+  }
+  for (i = 0; i < instance->softCount; i++) {
+    int satisfied = 0;
+    struct Literal * l;
+    for (l = instance->soft[i]->head; l != NULL && !satisfied; l = l->next) {
+      satisfied = valuation[abs(l->index)] == (l->index > 0 ? 1 : 0);
+    }
+    if (!satisfied) cost += instance->softWeights[i];
+  }
+
+  if (instance->upperBound != -1 && cost >= instance->upperBound) return;
+  instance->upperBound = cost;
+  instance->bestModel = realloc(instance->bestModel, (instance->originalVariables + 1) * sizeof(int));
+  memcpy(instance->bestModel, valuation, (instance->originalVariables + 1) * sizeof(int));
+  printf("o %lld\n", cost);
+  fflush(stdout);
+}
+
+// narrows an unsatisfiable set of assumed objective positions down to a core
+// the last refutation already names the positions it depends on. Each member is then
+// tried for removal: if the rest is still refuted within CORE_MINIMIZATION_BUDGET the
+// core shrinks to that refutation, otherwise the member stays. Returns the core size
+int extractCore(struct MaxSat * instance, int * core, int count){
+  int * assumptions = malloc((count + 1) * sizeof(int));
+  int * candidate = malloc((count + 1) * sizeof(int));
+
+  // refutation holds sorted positions into core, so it can be compacted in place
+  int i, j;
+  for (i = 0; i < refutationCount; i++) core[i] = core[refutation[i]];
+  count = refutationCount;
+
+  // members before position i are known to be needed
+  i = 0;
+  while (i < count) {
+    // try the core without its i-th member
+    int size = 0;
+    for (j = 0; j < count; j++) {
+      if (j == i) continue;
+      candidate[size] = core[j];
+      assumptions[size++] = instance->literals[core[j]].literal;
+    }
+    dpllBudget = CORE_MINIMIZATION_BUDGET;
+    int result = solveUnderAssumptions(instance, assumptions, size);
+    dpllBudget = -1;
+
+    if (result == UNSATISFIABLE) {
+      // the refutation may leave out more members, order is kept
+      int needed = 0;
+      for (j = 0; j < refutationCount; j++) {
+        core[j] = candidate[refutation[j]];
+        if (refutation[j] < i) needed++;
+      }
+      count = refutationCount;
+      i = needed;
+    } else {
+      // the models met on the way are still models of the hard clauses
+      if (result == SATISFIABLE) recordModel(instance);
+      i++;
+    }
+  }
+  free(assumptions);
+  free(candidate);
+  return count;
+}
+
+// relaxes a core: its weight moves into the lower bound and the members of the core
+// are replaced by soft bounds on how many of them may be violated (OLL)
+void relaxCore(struct MaxSat * instance, int * core, int count){
+  long long minimum = instance->literals[core[0]].weight;
+  int i;
+  for (i = 1; i < count; i++) {
+    if (instance->literals[core[i]].weight < minimum) minimum = instance->literals[core[i]].weight;
+  }
+  instance->lowerBound += minimum;
+  printf("c lower bound %lld\n", instance->lowerBound);
+  fflush(stdout);
+
+  int * violated = malloc(count * sizeof(int));
+  for (i = 0; i < count; i++) {
+    struct SoftLiteral * soft = &instance->literals[core[i]];
+    soft->weight -= minimum;
+    violated[i] = -soft->literal;
+
+    // a violated bound of an existing sum allows one more violation at the same price
+    struct Totalizer * totalizer = soft->totalizer;
+    int bound = soft->bound + 1;
+    if (totalizer != NULL && bound <= totalizer->size) {
+      extendTotalizer(instance, totalizer, bound);
+      addSoftLiteral(instance, -totalizer->outputs[bound - 1], minimum, totalizer, bound);
+    }
+  }
+
+  if (count == 1) {
+    // a single assumption can never hold again
+    instance->hard = addClause(instance->hard, violated, 1);
+  } else {
+    // at least one member of the core is violated, a second violation costs again
+    struct Totalizer * totalizer = buildTotalizer(violated, count);
+    extendTotalizer(instance, totalizer, 2);
+    addSoftLiteral(instance, -totalizer->outputs[1], minimum, totalizer, 2);
+  }
+  free(violated);
+}
+
+// core-guided MaxSAT optimization (OLL with weight stratification)
+// returns SATISFIABLE once the optimum is proven, UNSATISFIABLE when the hard clauses are
+int optimize(struct MaxSat * instance){
+  // start with the heaviest soft literals only, lighter ones join once those are satisfiable
+  long long level = 0;
+  int i;
+  for (i = 0; i < instance->literalCount; i++) {
+    if (instance->literals[i].weight > level) level = instance->literals[i].weight;
+  }
+
+  int * core = NULL;
+  int * assumptions = NULL;
+  while (1) {
+    core = realloc(core, (instance->literalCount + 1) * sizeof(int));
+    assumptions = realloc(assumptions, (instance->literalCount + 1) * sizeof(int));
+    int count = 0;
+    for (i = 0; i < instance->literalCount; i++) {
+      if (instance->literals[i].weight > 0 && instance->literals[i].weight >= level) {
+        core[count] = i;
+        assumptions[count++] = instance->literals[i].literal;
+      }
+    }
+
+    if (solveUnderAssumptions(instance, assumptions, count) == SATISFIABLE) {
+      recordModel(instance);
+      if (instance->upperBound == instance->lowerBound) break;
+
+      // move down to the next weight level
+      long long next = 0;
+      for (i = 0; i < instance->literalCount; i++) {
+        long long weight = instance->literals[i].weight;
+        if (weight < level && weight > next) next = weight;
+      }
+      if (next == 0) break;
+      level = next;
+      if (DEBUG) printf("Stratification level lowered to %lld\n", level);
+      continue;
+    }
+
+    count = extractCore(instance, core, count);
+    if (DEBUG) printf("Core of size %d found\n", count);
+    if (count == 0) {
+      free(core);
+      free(assumptions);
+      return UNSATISFIABLE;
+    }
+    relaxCore(instance, core, count);
+    if (instance->upperBound != -1 && instance->lowerBound >= instance->upperBound) break;
+  }
+  free(core);
+  free(assumptions);
+  return SATISFIABLE;
+}
+
+// runs the MaxSAT mode on a weighted formula and reports the optimum
+int solveMaxSat(char * problemFilename, char * solutionFilename){
+  struct MaxSat * instance = readWeightedClauseSet(problemFilename);
+
+  if (optimize(instance) == UNSATISFIABLE) {
+    printf("s UNSATISFIABLE\n");
+    return 0;
+  }
+
+  // report the model over the input variables only
+  variableNumber = instance->originalVariables;
+  memcpy(valuation, instance->bestModel, (variableNumber + 1) * sizeof(int));
+  printf("s OPTIMUM FOUND\n");
+  printf("o %lld\n", instance->upperBound);
+  printf("v");
+  int i;
+  for (i = 1; i < variableNumber + 1; i++) printf(" %d", valuation[i] ? i : -i);
+  printf(" 0\n");
+  writeSolution(NULL, solutionFilename);
+  return 0;
+}
+
 int main(int argc, char *argv[]){
   if (argc < 3) {
-    printf("usage: ./dpll [problemX.cnf] [solutionX.sol]\n");
+    printf("usage: ./dpll [problemX.cnf] [solutionX.sol] [cacheDir]\n");
+    printf("       ./dpll [problemX.wcnf] [solutionX.sol]\n");
     return 1;
   }
 
+  // weighted formulas are optimization problems
+  if (isWeightedFormula(argv[1])) return solveMaxSat(argv[1], argv[2]);
+
   struct Clause * root = readClauseSet(argv[1]);
 
-  if (dpll(root) == SATISFIABLE) {
+  // optionally answer repeated formulas from a content-addressed cache directory
+  char * cacheDir = argc > 3 ? argv[3] : NULL;
+  struct Formula * formula = NULL;
+  int result = UNCERTAIN;
+  if (cacheDir != NULL) {
+    mkdir(cacheDir, 0755);
+    formula = normalizeClauseSet(root);
+    result = cacheLookup(cacheDir, formula);
+    cacheCount(cacheDir, result != UNCERTAIN);
+  }
+  if (result == UNCERTAIN) {
+    result = dpll(root);
+    // dpll frees the clause set it is given
+    root = NULL;
+    if (cacheDir != NULL) cacheStore(cacheDir, formula, result);
+  }
+  if (formula != NULL) removeFormula(formula);
+
+  if (result == SATISFIABLE) {
     printf("SATISFIABLE\n");
     writeSolution(root, argv[2]);
   } else {